@@ -24,9 +24,26 @@ extern "C"
 #include <limits.h>
 #include <semaphore.h>
 #include <fcntl.h> /* For O_* constants */
+#include <stddef.h>
 
 #define NAME_MAX_BYTES 16
 
+// Copies of at least this many bytes use non-temporal (cache bypassing) stores, 0 disables them
+#define SHM_NT_THRESHOLD_DEFAULT (1024 * 1024)
+
+#define MCAST_MAGIC 0x53484d31  // "SHM1"
+#define MCAST_MAX_PAYLOAD 65024 // Largest segment payload that fits a single datagram
+
+#define MCAST_FLAG_SCHEMA 0x1   // Payload is encoded with the schema of the segment
+#define MCAST_FLAG_KEYFRAME 0x2 // Encoded payload contains every field of the schema
+
+#define SHM_SCHEMA_MAGIC 0x53434831 // "SCH1"
+#define SHM_SCHEMA_MAX_FIELDS 32
+
+// Size of a segment that holds size bytes of data and a schema descriptor, the descriptor
+// starts 8 byte aligned after the data
+#define SHM_SCHEMA_SEG_SIZE(size) ((((size) + 7) & ~(size_t)7) + sizeof(shmSchema_t))
+
     // #define DEBUG_SHARED_MEM // Enabled or disable printf's
 
     typedef struct
@@ -42,25 +59,172 @@ extern "C"
         uint8_t w_blocking_flag;
         uint8_t r_unlock_flag;
         uint8_t w_lock_flag;
+        size_t nt_threshold; // Streaming copy threshold of shm_write
 
     } semShm_t;
+
+    // Header in front of every multicast datagram, all fields in network byte order
+    typedef struct __attribute__((packed))
+    {
+        uint32_t magic;    // MCAST_MAGIC
+        int32_t key;       // Key of the mirrored shared memory segment
+        uint32_t seq;      // Incremented by the sender for every datagram of this key
+        uint16_t len;      // Payload bytes following this header
+        uint16_t flags;    // MCAST_FLAG_*
+        uint64_t stamp_ns; // CLOCK_MONOTONIC of the sender, used for latency statistics
+    } mcastHdr_t;
+    typedef enum
+    {
+        SHM_FIELD_U8,
+        SHM_FIELD_S8,
+        SHM_FIELD_U16,
+        SHM_FIELD_S16,
+        SHM_FIELD_U32,
+        SHM_FIELD_S32,
+        SHM_FIELD_U64,
+        SHM_FIELD_S64,
+        SHM_FIELD_F32,
+        SHM_FIELD_F64,
+        SHM_FIELD_BYTES
+    } shmFieldType_t;
+
+    // One field of a (packed, host-endian) segment layout
+    typedef struct
+    {
+        uint16_t offset; // Byte offset in the segment, may be unaligned
+        uint16_t size;   // Size in bytes, must match the type except for SHM_FIELD_BYTES
+        uint8_t type;    // shmFieldType_t
+        float scale;     // Floats only: sent as round(value / scale), 0 sends the full float
+    } shmField_t;
+
+    // Layout of a segment, stored at the end of the segment by shmSchemaRegister
+    typedef struct
+    {
+        uint32_t magic; // SHM_SCHEMA_MAGIC when registered, set by shmSchemaRegister
+        uint16_t size;  // Bytes of segment data covered by the schema
+        uint16_t n_fields;
+        shmField_t fields[SHM_SCHEMA_MAX_FIELDS];
+    } shmSchema_t;
+
+// Field declarations for a layout given by offsets
+#define SHM_FIELD(type, offset, size) {(offset), (size), (type), 0}
+#define SHM_FIELD_QUANT(type, offset, size, scale) {(offset), (size), (type), (scale)}
+
+// Integer field type from signedness and size, used by SHM_FIELD_MEMBER
+#define SHM_FIELD_INT(is_signed, size)                                \
+    ((size) == 1 ? ((is_signed) ? SHM_FIELD_S8 : SHM_FIELD_U8)       \
+     : (size) == 2 ? ((is_signed) ? SHM_FIELD_S16 : SHM_FIELD_U16)   \
+     : (size) == 4 ? ((is_signed) ? SHM_FIELD_S32 : SHM_FIELD_U32)   \
+                   : ((is_signed) ? SHM_FIELD_S64 : SHM_FIELD_U64))
+
     void *shmOpen(int key, int size, int *shmid, sem_t **sem, int *newSegment);
     int shmRemove(int shmid, void *segptr);
     int lockSemaphore(sem_t *sem, int blocking);
     int shmWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int lock);
+    int shmWriteEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int lock, size_t nt_threshold);
     int shmRead(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int unlock);
+    int shmReadEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int unlock, size_t nt_threshold);
     int shmReadWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int (*f)(void *object));
+    int shmReadWriteEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int (*f)(void *object), size_t nt_threshold);
     int openSemForShm(int shmid, sem_t **sem);
     int closeSemForShm(int shmid);
     int getSemVal(sem_t *sem);
+    void shmCopy(void *dst, const void *src, size_t size, size_t nt_threshold);
+    void shmSetNtThreshold(size_t nt_threshold);
+    size_t shmGetNtThreshold(void);
+    const char *shmCopyKernel(void);
+    int shmSchemaValidate(const shmSchema_t *schema);
+    uint32_t shmSchemaHash(const shmSchema_t *schema);
+    int shmSchemaOffset(int shmid);
+    int shmSchemaRegister(int shmid, void *segptr, const shmSchema_t *schema);
+    int shmSchemaFind(int shmid, void *segptr, shmSchema_t *schema);
+    int shmSchemaEncode(const shmSchema_t *schema, const void *object, const void *prev, uint8_t *buffer, int size);
+    int shmSchemaDecode(const shmSchema_t *schema, const uint8_t *buffer, int size, void *object);
 
-    int8_t init_shared_mem(semShm_t *shm, int8_t key, uint16_t size);
+    int8_t init_shared_mem(semShm_t *shm, int8_t key, uint32_t size);
     int8_t shm_remove(semShm_t *shm);
-    int8_t shm_write(semShm_t *shm, void *data, uint16_t size);
-    int8_t shm_read(semShm_t *shm, void *data, uint16_t size);
+    int8_t shm_write(semShm_t *shm, void *data, uint32_t size);
+    int8_t shm_read(semShm_t *shm, void *data, uint32_t size);
+    int8_t shm_register_schema(semShm_t *shm, const shmSchema_t *schema);
 
 #ifdef __cplusplus
 } /* extern "C" */
+
+#if __cplusplus >= 201103L
+#include <type_traits>
+
+// Field type of a struct member, used by SHM_FIELD_MEMBER. Integers and enums map by signedness
+// and size, plain char (signed or not per host) is always U8, only char arrays are sent as bytes,
+// anything else does not compile
+template <typename T, typename Enable = void>
+struct shmFieldTypeOf
+{
+    static_assert(sizeof(T) == 0, "unsupported shared field type, declare the field with SHM_FIELD");
+};
+template <typename T>
+struct shmFieldTypeOf<T, typename std::enable_if<std::is_integral<T>::value>::type>
+{
+    static const uint8_t value = SHM_FIELD_INT(std::is_signed<T>::value, sizeof(T));
+};
+template <typename T>
+struct shmFieldTypeOf<T, typename std::enable_if<std::is_enum<T>::value>::type>
+    : shmFieldTypeOf<typename std::underlying_type<T>::type>
+{
+};
+template <> struct shmFieldTypeOf<char> { static const uint8_t value = SHM_FIELD_U8; };
+template <> struct shmFieldTypeOf<float> { static const uint8_t value = SHM_FIELD_F32; };
+template <> struct shmFieldTypeOf<double> { static const uint8_t value = SHM_FIELD_F64; };
+template <size_t N> struct shmFieldTypeOf<char[N]> { static const uint8_t value = SHM_FIELD_BYTES; };
+template <size_t N> struct shmFieldTypeOf<signed char[N]> { static const uint8_t value = SHM_FIELD_BYTES; };
+template <size_t N> struct shmFieldTypeOf<unsigned char[N]> { static const uint8_t value = SHM_FIELD_BYTES; };
+
+#define SHM_FIELD_TYPE_OF(st, member) (shmFieldTypeOf<decltype(((st *)0)->member)>::value)
+#endif // __cplusplus >= 201103L
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define SHM_FIELD_INVALID 0xff
+
+// Integers (and enums, compatible with one of them) map by signedness and size, plain char is
+// always U8 so hosts with a signed and an unsigned char agree. Arrays decay to pointers in
+// _Generic, so only char arrays are listed, as bytes
+#define SHM_FIELD_TYPE_SELECT(st, member) _Generic((((st *)0)->member), \
+    _Bool: SHM_FIELD_U8,                                                 \
+    char: SHM_FIELD_U8,                                                  \
+    signed char: SHM_FIELD_S8,                                           \
+    unsigned char: SHM_FIELD_U8,                                         \
+    short: SHM_FIELD_INT(1, sizeof(short)),                              \
+    unsigned short: SHM_FIELD_INT(0, sizeof(unsigned short)),            \
+    int: SHM_FIELD_INT(1, sizeof(int)),                                  \
+    unsigned int: SHM_FIELD_INT(0, sizeof(unsigned int)),                \
+    long: SHM_FIELD_INT(1, sizeof(long)),                                \
+    unsigned long: SHM_FIELD_INT(0, sizeof(unsigned long)),              \
+    long long: SHM_FIELD_INT(1, sizeof(long long)),                      \
+    unsigned long long: SHM_FIELD_INT(0, sizeof(unsigned long long)),    \
+    float: SHM_FIELD_F32,                                                \
+    double: SHM_FIELD_F64,                                               \
+    char *: SHM_FIELD_BYTES,                                             \
+    signed char *: SHM_FIELD_BYTES,                                      \
+    unsigned char *: SHM_FIELD_BYTES,                                    \
+    default: SHM_FIELD_INVALID)
+
+// Same as the C++ version: unsupported types and char pointers (not arrays) do not compile
+#define SHM_FIELD_TYPE_OF(st, member)                                                                   \
+    (0 * sizeof(struct {                                                                                \
+         _Static_assert(SHM_FIELD_TYPE_SELECT(st, member) != SHM_FIELD_INVALID,                         \
+                        "unsupported shared field type, declare the field with SHM_FIELD");             \
+         _Static_assert(SHM_FIELD_TYPE_SELECT(st, member) != SHM_FIELD_BYTES ||                         \
+                            !__builtin_types_compatible_p(__typeof__(((st *)0)->member),                \
+                                                          __typeof__(((st *)0)->member + 0)),           \
+                        "pointer members can not be shared");                                           \
+         int dummy;                                                                                     \
+     }) + SHM_FIELD_TYPE_SELECT(st, member))
+#endif
+
+// Field declarations generated from a (packed) struct, needs C11 or C++11
+#ifdef SHM_FIELD_TYPE_OF
+#define SHM_FIELD_MEMBER(st, member) \
+    {offsetof(st, member), sizeof(((st *)0)->member), SHM_FIELD_TYPE_OF(st, member), 0}
+#define SHM_FIELD_MEMBER_QUANT(st, member, scale) \
+    {offsetof(st, member), sizeof(((st *)0)->member), SHM_FIELD_TYPE_OF(st, member), (scale)}
 #endif
 
 #endif // SHARED_DATA_H
\ No newline at end of file
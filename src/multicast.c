@@ -1,54 +1,552 @@
-#include "unistd.h"
+/**
+ *
+ * @author Azzam Wildan Maulana - IRIS ITS
+ *
+ * Multicast bridge, receive side.
+ * Receives mirrored shared memory segments from the local network and writes
+ * them into the local segments listed in config/data.txt.
+ *
+ * Datagrams are received in batches with recvmmsg into preallocated buffers,
+ * optionally with SO_BUSY_POLL and/or spinning on a pinned core.
+ *
+ * Segments with a registered schema can be sent encoded (MCAST_FLAG_SCHEMA),
+ * those are decoded into a staging copy of the segment before it is written.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "shared_data.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAX_SEGMENTS 64
+#define MAX_BATCH 256
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+#define HIST_SUB_BITS 3 // 8 buckets per power of two, ~12% resolution
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define MAX_LATENCY_NS 10000000000ll // Larger differences come from unrelated clocks
+#define REORDER_WINDOW 64 // Older sequence numbers than this are taken as a sender restart
+#define SCHEMA_LOOKUP_INTERVAL_NS 100000000ull
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
 
 typedef struct config_tag
 {
     uint16_t port;
     char multicast_addr[20];
+    char iface_addr[20]; // Local interface to join the group on
+    int batch;           // Datagrams per recvmmsg call, 1 behaves like recvfrom
+    int busy_poll;       // SO_BUSY_POLL in us, 0 disables
+    int spin;            // Poll with MSG_DONTWAIT instead of sleeping in the kernel
+    int cpu;             // Core to pin the receive loop to, -1 disables
+    int stats;           // Print packets/s and latency percentiles every second
 } config_t;
 
+typedef struct segment_tag
+{
+    char name[32];
+    int key;
+    int size;
+    uint32_t seq;
+    uint64_t received;
+    uint64_t lost;
+    int synced;                 // Staging holds a complete state, deltas may be applied
+    uint8_t *staging;           // Last decoded state of an encoded segment
+    int has_schema;             // Schema below is valid
+    shmSchema_t schema;         // Validated copy of the schema registered in the segment
+    uint64_t schema_lookup_ns;  // Last time we looked for a schema
+    int schema_offset;          // Offset of the schema slot in the segment, -1 if it has none
+    semShm_t shm;
+} segment_t;
+
+typedef struct stats_tag
+{
+    uint64_t packets;
+    uint64_t dropped;
+    uint64_t n_samples;
+    uint64_t max_ns;
+    uint64_t hist[HIST_BUCKETS]; // Log bucketed latency in ns, only meaningful when sender and receiver share a clock
+} stats_t;
+
+config_t cfg;
+segment_t segments[MAX_SEGMENTS];
+int n_segments = 0;
+volatile sig_atomic_t running = 1;
+
+void sigint_handler(int sig)
+{
+    running = 0;
+}
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ *
+ * @brief Load config/multicast.cfg, lines are "name: value", # starts a comment
+ *
+ * @return -1 if an error occured ||
+ * 			0 if success
+ */
 int8_t load_config(config_t *cfg)
 {
     char *filename = "config/multicast.cfg";
     FILE *f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    strcpy(cfg->iface_addr, "0.0.0.0");
+    cfg->batch = 32;
+    cfg->busy_poll = 0;
+    cfg->spin = 0;
+    cfg->cpu = -1;
+    cfg->stats = 0;
 
     char buffer[BUFSIZ];
-    char *line;
-    int i;
+    char name[32];
+    char value[64];
     while (fgets(buffer, sizeof(buffer), f) != NULL)
     {
-        for (i = 0; i < strlen(buffer); i++)
-        { // iterate through the chars in a line
-            if (buffer[i] == '\n' || buffer[i] == NULL)
-            { // if char is a #, stop processing chars on this line
-                break;
-            }
-            else if (buffer[i] == ' ')
-            { // if char is whitespace, continue until something is found
-                continue;
-            }
-            else
-            {
-                if (buffer[0] == 'a' && buffer[1] == 'd' && buffer[2] == 'd' && buffer[3] == 'r')
-                    sscanf(buffer, "addr: %s", cfg->multicast_addr);
-                else if (buffer[0] == 'p' && buffer[1] == 'o' && buffer[2] == 'r' && buffer[3] == 't')
-                    sscanf(buffer, "port: %d", &cfg->port);
-                break;
-            }
+        char *comment = strchr(buffer, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        if (sscanf(buffer, " %31[^: ] : %63s", name, value) != 2)
+            continue;
+
+        if (strcmp(name, "addr") == 0)
+            snprintf(cfg->multicast_addr, sizeof(cfg->multicast_addr), "%s", value);
+        else if (strcmp(name, "port") == 0)
+            cfg->port = atoi(value);
+        else if (strcmp(name, "iface") == 0)
+            snprintf(cfg->iface_addr, sizeof(cfg->iface_addr), "%s", value);
+        else if (strcmp(name, "batch") == 0)
+            cfg->batch = atoi(value);
+        else if (strcmp(name, "busy_poll") == 0)
+            cfg->busy_poll = atoi(value);
+        else if (strcmp(name, "spin") == 0)
+            cfg->spin = atoi(value);
+        else if (strcmp(name, "cpu") == 0)
+            cfg->cpu = atoi(value);
+        else if (strcmp(name, "stats") == 0)
+            cfg->stats = atoi(value);
+        else
+            printf("%s: unknown option %s\n", filename, name);
+    }
+
+    if (cfg->batch < 1)
+        cfg->batch = 1;
+    if (cfg->batch > MAX_BATCH)
+        cfg->batch = MAX_BATCH;
+
+    fclose(f);
+    return 0;
+}
+
+/**
+ *
+ * @brief Load config/data.txt and open every segment that is shared to the local network
+ *
+ * @return -1 if an error occured ||
+ * 			0 if success
+ */
+int8_t load_segments()
+{
+    char *filename = "config/data.txt";
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    char buffer[BUFSIZ];
+    while (fgets(buffer, sizeof(buffer), f) != NULL && n_segments < MAX_SEGMENTS)
+    {
+        segment_t *seg = &segments[n_segments];
+        int shared = 0;
+        seg->size = 64;
+
+        if (sscanf(buffer, "%31s %d %d %d", seg->name, &seg->key, &shared, &seg->size) < 3 || !shared)
+            continue;
+
+        if (seg->size < 1 || seg->size > MCAST_MAX_PAYLOAD)
+        {
+            printf("%s: size of %s must be 1..%d bytes\n", filename, seg->name, MCAST_MAX_PAYLOAD);
+            continue;
+        }
+
+        // Same defaults as init_shared_mem, keys in data.txt do not fit its int8_t key.
+        // When we create the segment leave room for a schema, so local processes can register one later
+        semShm_t *shm = &seg->shm;
+        shm->key = seg->key;
+        int open_size = shmget(shm->key, 0, 0) == -1 ? SHM_SCHEMA_SEG_SIZE(seg->size) : seg->size;
+        if ((shm->segptr = shmOpen(shm->key, open_size, &shm->shmid, &shm->sem, &shm->createdSegment)) == (void *)-1)
+        {
+            printf("Failed open shared memory %s (%d)\n", seg->name, seg->key);
+            continue;
         }
+        if (shm->createdSegment)
+            sem_post(shm->sem);
+
+        shm->w_blocking_flag = 1;
+        shm->w_lock_flag = 0;
+        shm->r_blocking_flag = 0;
+        shm->r_unlock_flag = 0;
+        shm->nt_threshold = shmGetNtThreshold();
+
+        seg->staging = calloc(1, seg->size);
+        seg->has_schema = 0;
+        seg->schema_lookup_ns = 0;
+        seg->synced = 0;
+        seg->schema_offset = shmSchemaOffset(shm->shmid);
+        if (seg->schema_offset != -1 && seg->size > seg->schema_offset)
+            printf("%s: size of %s (%d) reaches into the schema slot at %d, raw writes are cut there once a schema is registered\n",
+                   filename, seg->name, seg->size, seg->schema_offset);
+
+        printf("Mirroring %s (key: %d, size: %d)\n", seg->name, seg->key, seg->size);
+        n_segments++;
     }
 
     fclose(f);
+    return 0;
+}
+
+segment_t *find_segment(int key)
+{
+    for (int i = 0; i < n_segments; i++)
+        if (segments[i].key == key)
+            return &segments[i];
+    return NULL;
+}
+
+/**
+ *
+ * @brief Create the multicast socket, bind it to the configured port and join the group
+ *
+ * @return socket fd ||
+ * 			-1 if an error occured
+ */
+int open_socket(config_t *cfg)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Room for a few batches while the loop is busy writing segments. The kernel silently
+    // caps it at net.core.rmem_max (and reports double the usable size)
+    int rcvbuf = RCVBUF_SIZE;
+    socklen_t optlen = sizeof(rcvbuf);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == 0 && rcvbuf / 2 < RCVBUF_SIZE)
+        printf("Warning: SO_RCVBUF is %d bytes instead of %d, raise net.core.rmem_max to avoid drops\n",
+               rcvbuf / 2, RCVBUF_SIZE);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = inet_addr(cfg->multicast_addr);
+    mreq.imr_interface.s_addr = inet_addr(cfg->iface_addr);
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+    {
+        perror("IP_ADD_MEMBERSHIP");
+        close(fd);
+        return -1;
+    }
+
+    if (cfg->busy_poll > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &cfg->busy_poll, sizeof(cfg->busy_poll)) == -1)
+        perror("SO_BUSY_POLL (needs CAP_NET_ADMIN above net.core.busy_read)");
+
+    // Wake up periodically when idle to print stats and check for SIGINT
+    if (!cfg->spin)
+    {
+        struct timeval tv = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    return fd;
+}
+
+/**
+ *
+ * @brief Histogram bucket of a latency: exact below 2^HIST_SUB_BITS ns, above that
+ * 2^HIST_SUB_BITS buckets per power of two
+ */
+int hist_bucket(uint64_t ns)
+{
+    if (ns < (1 << HIST_SUB_BITS))
+        return ns;
+    int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + ((ns >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// Smallest latency in ns that falls in a bucket
+uint64_t hist_lower(int bucket)
+{
+    if (bucket < (1 << HIST_SUB_BITS))
+        return bucket;
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    return (uint64_t)((1 << HIST_SUB_BITS) + (bucket & ((1 << HIST_SUB_BITS) - 1))) << shift;
+}
+
+// Latency in us at a percentile, the upper bound of its bucket
+double hist_percentile(stats_t *stats, double percentile)
+{
+    uint64_t target = (uint64_t)(stats->n_samples * percentile / 100.0);
+    uint64_t count = 0;
+    for (int i = 0; i < HIST_BUCKETS - 1; i++)
+    {
+        count += stats->hist[i];
+        if (count > target)
+        {
+            uint64_t upper = hist_lower(i + 1) - 1;
+            return (upper < stats->max_ns ? upper : stats->max_ns) / 1e3;
+        }
+    }
+    return stats->max_ns / 1e3;
+}
+
+void print_stats(stats_t *stats, double seconds)
+{
+    uint64_t lost = 0;
+    for (int i = 0; i < n_segments; i++)
+    {
+        lost += segments[i].lost;
+        segments[i].lost = 0;
+    }
+
+    if (stats->n_samples == 0)
+    {
+        printf("%10.0f pkt/s | dropped: %lu | lost: %lu\n", stats->packets / seconds, stats->dropped, lost);
+    }
+    else
+    {
+        printf("%10.0f pkt/s | latency us p50: %.1f p99: %.1f p99.9: %.1f max: %.1f | dropped: %lu | lost: %lu\n",
+               stats->packets / seconds, hist_percentile(stats, 50), hist_percentile(stats, 99),
+               hist_percentile(stats, 99.9), stats->max_ns / 1e3, stats->dropped, lost);
+    }
+
+    memset(stats, 0, sizeof(stats_t));
+}
+
+/**
+ *
+ * @brief Validate one received datagram and write its payload into the target segment
+ *
+ * @return -1 if the datagram was dropped ||
+ * 			0 if success
+ */
+int8_t handle_datagram(mcastHdr_t *hdr, uint8_t *payload, unsigned int bytes, stats_t *stats, uint64_t now)
+{
+    if (bytes < sizeof(mcastHdr_t) || ntohl(hdr->magic) != MCAST_MAGIC)
+        return -1;
+
+    uint16_t len = ntohs(hdr->len);
+    uint16_t flags = ntohs(hdr->flags);
+    segment_t *seg = find_segment((int32_t)ntohl(hdr->key));
+    if (seg == NULL || len != bytes - sizeof(mcastHdr_t))
+        return -1;
+
+    uint32_t seq = ntohl(hdr->seq);
+    if (seg->received)
+    {
+        int32_t gap = (int32_t)(seq - seg->seq - 1);
+        if (gap > 0)
+        {
+            seg->lost += gap;
+            seg->synced = 0;
+        }
+        else if (gap < 0 && gap >= -REORDER_WINDOW && seq != 0)
+        {
+            // Duplicate or reordered datagram, older than what the segment already holds
+            return -1;
+        }
+        else if (gap < 0)
+        {
+            // Sender restarted, follow its new sequence
+            seg->synced = 0;
+        }
+    }
+    seg->seq = seq;
+    seg->received++;
+
+    if (!(flags & MCAST_FLAG_SCHEMA))
+    {
+        if (len > seg->size)
+            return -1;
+
+        // Never let a raw datagram overwrite a registered schema
+        if (seg->schema_offset != -1 && len > seg->schema_offset)
+        {
+            shmSchema_t *slot = (shmSchema_t *)((uint8_t *)seg->shm.segptr + seg->schema_offset);
+            if (__atomic_load_n(&slot->magic, __ATOMIC_ACQUIRE) == SHM_SCHEMA_MAGIC)
+                len = seg->schema_offset;
+        }
+        shm_write(&seg->shm, payload, len);
+    }
+    else
+    {
+        // The schema is registered by a local process, it may appear after we started.
+        // Looking costs a syscall, so do not look for every datagram
+        if (!seg->has_schema)
+        {
+            if (now - seg->schema_lookup_ns < SCHEMA_LOOKUP_INTERVAL_NS)
+                return -1;
+            seg->schema_lookup_ns = now;
+
+            if (shmSchemaFind(seg->shm.shmid, seg->shm.segptr, &seg->schema) == -1 || seg->schema.size > seg->size)
+                return -1;
+            seg->has_schema = 1;
+        }
+
+        // After a lost datagram deltas are useless until the next keyframe
+        if (!(flags & MCAST_FLAG_KEYFRAME) && !seg->synced)
+            return -1;
+
+        // Keyframes carry the schema hash of the sender, only a matching one (1) syncs the segment.
+        // On a mismatch the local schema may have been registered again, so look it up again
+        int decoded = shmSchemaDecode(&seg->schema, payload, len, seg->staging);
+        if (decoded == -1)
+        {
+            seg->synced = 0;
+            seg->has_schema = 0;
+            return -1;
+        }
+        if (decoded == 0 && !seg->synced)
+            return -1;
+        seg->synced = 1;
+        shm_write(&seg->shm, seg->staging, seg->schema.size);
+    }
+
+    // CLOCK_MONOTONIC of another host is unrelated to ours, skip what can not be a latency
+    int64_t latency = (int64_t)(now - be64toh(hdr->stamp_ns));
+    if (cfg.stats && latency >= 0 && latency <= MAX_LATENCY_NS)
+    {
+        stats->hist[hist_bucket(latency)]++;
+        stats->n_samples++;
+        if ((uint64_t)latency > stats->max_ns)
+            stats->max_ns = latency;
+    }
+    return 0;
 }
 
 int main()
 {
-    config_t cfg;
-    load_config(&cfg);
+    if (load_config(&cfg) == -1)
+        return 1;
     printf("addr: %s\n", cfg.multicast_addr);
     printf("port: %d\n", cfg.port);
+    printf("iface: %s | batch: %d | busy_poll: %d | spin: %d | cpu: %d\n",
+           cfg.iface_addr, cfg.batch, cfg.busy_poll, cfg.spin, cfg.cpu);
+
+    if (load_segments() == -1)
+        return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler; // No SA_RESTART, so a blocking recvmmsg returns
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (cfg.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1)
+            perror("sched_setaffinity");
+    }
+
+    int fd = open_socket(&cfg);
+    if (fd == -1)
+        return 1;
+
+    // Preallocate all receive buffers, headers and payloads land in separate iovecs so
+    // the payload is copied to the segment once, by shm_write under the segment semaphore
+    static mcastHdr_t hdrs[MAX_BATCH];
+    static struct iovec iovs[MAX_BATCH][2];
+    static struct mmsghdr msgs[MAX_BATCH];
+    uint8_t *payloads = aligned_alloc(64, (size_t)cfg.batch * MCAST_MAX_PAYLOAD);
+    for (int i = 0; i < cfg.batch; i++)
+    {
+        iovs[i][0].iov_base = &hdrs[i];
+        iovs[i][0].iov_len = sizeof(mcastHdr_t);
+        iovs[i][1].iov_base = payloads + (size_t)i * MCAST_MAX_PAYLOAD;
+        iovs[i][1].iov_len = MCAST_MAX_PAYLOAD;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+
+    int flags = cfg.spin ? MSG_DONTWAIT : MSG_WAITFORONE;
+    uint64_t last_report = now_ns();
+    while (running)
+    {
+        int n = recvmmsg(fd, msgs, cfg.batch, flags, NULL);
+        if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            perror("recvmmsg");
+            break;
+        }
+
+        uint64_t now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            stats.packets++;
+            if (handle_datagram(&hdrs[i], iovs[i][1].iov_base, msgs[i].msg_len, &stats, now) == -1)
+                stats.dropped++;
+        }
+
+        if (cfg.stats && now - last_report >= 1000000000ull)
+        {
+            print_stats(&stats, (now - last_report) / 1e9);
+            last_report = now;
+        }
+    }
+
+    close(fd);
+    free(payloads);
+    for (int i = 0; i < n_segments; i++)
+    {
+        free(segments[i].staging);
+        shm_remove(&segments[i].shm);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -12,6 +12,23 @@
  */
 
 #include "shared_data.h"
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHM_COPY_X86
+#endif
+
+typedef void (*shmCopyFn_t)(void *dst, const void *src, size_t size);
+
+static void shmCopyPlain(void *dst, const void *src, size_t size);
+
+// Streaming copy kernel, selected at load time by shmCopyResolve()
+static shmCopyFn_t shmCopyStream = shmCopyPlain;
+static const char *shmCopyStreamName = "memcpy";
+
+// Threshold used by shmWrite and shmReadWrite
+static size_t shmNtThreshold = SHM_NT_THRESHOLD_DEFAULT;
 
 /**
  *
@@ -177,6 +194,20 @@ int lockSemaphore(sem_t *sem, int blocking)
  *			0		- If succes
  */
 int shmWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int lock)
+{
+    return shmWriteEx(object, size, shmid, segptr, sem, blocking, lock, shmNtThreshold);
+}
+
+/**
+ *
+ * @brief Same as shmWrite, with the streaming copy threshold for this write
+ *
+ * @param nt_threshold: Minimum size (in Bytes) for a streaming copy, 0 to disable
+ *
+ * @return -1 		- If an error occured ||
+ *			0		- If succes
+ */
+int shmWriteEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int lock, size_t nt_threshold)
 {
 #ifdef DEBUG_SHARED_MEM
     printf("shmWrite, blocking: %d, locking: %d\n", blocking, lock);
@@ -192,7 +223,7 @@ int shmWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int bl
 #ifdef DEBUG_SHARED_MEM
     printf("Writing, memcpy to address: %lu | size: %d...\n", (unsigned long int)segptr, size);
 #endif
-    memcpy(segptr, object, size);
+    shmCopy(segptr, object, size, nt_threshold);
 
     // After this critical section we release the lock
     sem_post(sem);
@@ -211,10 +242,27 @@ int shmWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int bl
  * @param blocking:    Indicate blocking or non-blocking mode
  * @param unlock:      Indicate if after locking and writing the semaphore should be unlocked, used in case of custom critical read write operation
  *
+ * 						The object is read with a regular memcpy, the caller is about to use it so it should
+ * 						stay in the cache. Use shmReadEx to stream reads of frames that are only handed on.
+ *
  * @return -1 		- If an error occured ||
  *			0		- If succes
  */
 int shmRead(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int unlock)
+{
+    return shmReadEx(object, size, shmid, segptr, sem, blocking, unlock, 0);
+}
+
+/**
+ *
+ * @brief Same as shmRead, with the streaming copy threshold for this read
+ *
+ * @param nt_threshold: Minimum size (in Bytes) for a streaming copy, 0 to disable
+ *
+ * @return -1 		- If an error occured ||
+ *			0		- If succes
+ */
+int shmReadEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int unlock, size_t nt_threshold)
 {
 #ifdef DEBUG_SHARED_MEM
     printf("shmRead, blocking: %d, unlocking: %d\n", blocking, unlock);
@@ -228,7 +276,7 @@ int shmRead(void *object, int size, int shmid, void *segptr, sem_t *sem, int blo
 #endif
 
     // At this momement a lock is obtained, so we can read the memory segment
-    memcpy(object, segptr, size);
+    shmCopy(object, segptr, size, nt_threshold);
 
     if (unlock)
     {
@@ -257,11 +305,26 @@ int shmRead(void *object, int size, int shmid, void *segptr, sem_t *sem, int blo
  * 							foo.value = foo.value + 1;
  * 						}
  *
+ * 						The object is read with a regular memcpy since f() uses it right away.
  *
  * @return -1 		- If an error occured ||
  *			0		- If succes
  */
 int shmReadWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int (*f)(void *object))
+{
+    return shmReadWriteEx(object, size, shmid, segptr, sem, blocking, f, shmNtThreshold);
+}
+
+/**
+ *
+ * @brief Same as shmReadWrite, with the streaming copy threshold for the write back
+ *
+ * @param nt_threshold: Minimum size (in Bytes) for a streaming copy, 0 to disable
+ *
+ * @return -1 		- If an error occured ||
+ *			0		- If succes
+ */
+int shmReadWriteEx(void *object, int size, int shmid, void *segptr, sem_t *sem, int blocking, int (*f)(void *object), size_t nt_threshold)
 {
     // Lock semaphore, either blocking or non-blocking
     if (lockSemaphore(sem, blocking) == -1)
@@ -273,8 +336,9 @@ int shmReadWrite(void *object, int size, int shmid, void *segptr, sem_t *sem, in
     // The critical section function is called with the object
     f(object);
 
-    // And the object is written back to the shared memory segement
-    memcpy(segptr, object, size);
+    // And the object is written back to the shared memory segement, the object itself is
+    // no longer needed by this process so large objects bypass the cache
+    shmCopy(segptr, object, size, nt_threshold);
 
     // After the critical section we release the lock
     sem_post(sem);
@@ -376,6 +440,682 @@ int getSemVal(sem_t *sem)
     return sem_value;
 }
 
+/**
+ *
+ * @brief Copy size bytes from src to dst. Copies of at least nt_threshold bytes use
+ * non-temporal stores, so large frames do not evict the working set of the copying
+ * process from the cache. Smaller copies (or nt_threshold 0) use a plain memcpy.
+ *
+ * @param *dst:        Destination buffer
+ * @param *src:        Source buffer
+ * @param size:        How many data to copy (in Bytes)
+ * @param nt_threshold: Minimum size (in Bytes) for a streaming copy, 0 to disable
+ */
+void shmCopy(void *dst, const void *src, size_t size, size_t nt_threshold)
+{
+    if (nt_threshold && size >= nt_threshold)
+        shmCopyStream(dst, src, size);
+    else
+        memcpy(dst, src, size);
+}
+
+/**
+ *
+ * @brief Set the streaming copy threshold used by shmWrite, shmReadWrite and by
+ * segments initialized afterwards with init_shared_mem. Per segment the threshold
+ * can be changed with the nt_threshold field of semShm_t, per call with shmWriteEx
+ * and shmReadWriteEx.
+ *
+ * @param nt_threshold: Minimum size (in Bytes) for a streaming copy, 0 to disable
+ */
+void shmSetNtThreshold(size_t nt_threshold)
+{
+    shmNtThreshold = nt_threshold;
+}
+
+/**
+ *
+ * @brief Return the streaming copy threshold used by shmWrite and shmReadWrite
+ */
+size_t shmGetNtThreshold(void)
+{
+    return shmNtThreshold;
+}
+
+/**
+ *
+ * @brief Return the name of the streaming copy kernel selected for this CPU
+ */
+const char *shmCopyKernel(void)
+{
+    return shmCopyStreamName;
+}
+
+static void shmCopyPlain(void *dst, const void *src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+
+#ifdef SHM_COPY_X86
+__attribute__((target("sse2"))) static void shmCopyStreamSse2(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    // Streaming stores must be aligned, copy the head up to the first 16 byte boundary
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > size)
+        head = size;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+
+    // Make the streamed data globally visible before the semaphore is released
+    _mm_sfence();
+    memcpy(d, s, size);
+}
+
+__attribute__((target("avx"))) static void shmCopyStreamAvx(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    // Streaming stores must be aligned, copy the head up to the first 32 byte boundary
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    if (head > size)
+        head = size;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 128; size -= 128, d += 128, s += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+
+    // Make the streamed data globally visible before the semaphore is released
+    _mm_sfence();
+    _mm256_zeroupper();
+    memcpy(d, s, size);
+}
+#endif
+
+/**
+ *
+ * @brief Select the streaming copy kernel for the CPU we are running on, called
+ * once when the library is loaded.
+ */
+__attribute__((constructor)) static void shmCopyResolve(void)
+{
+#ifdef SHM_COPY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+        shmCopyStream = shmCopyStreamAvx;
+        shmCopyStreamName = "avx";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        shmCopyStream = shmCopyStreamSse2;
+        shmCopyStreamName = "sse2";
+    }
+#endif
+}
+
+/**
+ *
+ * @brief Return the size in bytes of a field type, -1 for SHM_FIELD_BYTES or an invalid type
+ */
+static int shmFieldTypeSize(uint8_t type)
+{
+    switch (type)
+    {
+    case SHM_FIELD_U8:
+    case SHM_FIELD_S8:
+        return 1;
+    case SHM_FIELD_U16:
+    case SHM_FIELD_S16:
+        return 2;
+    case SHM_FIELD_U32:
+    case SHM_FIELD_S32:
+    case SHM_FIELD_F32:
+        return 4;
+    case SHM_FIELD_U64:
+    case SHM_FIELD_S64:
+    case SHM_FIELD_F64:
+        return 8;
+    default:
+        return -1;
+    }
+}
+
+/**
+ *
+ * @brief Return the offset of the schema descriptor in a segment, the last 8 byte aligned
+ * offset that still fits the descriptor. Data written beyond it overwrites the schema.
+ *
+ * @param shmid:     	The id of a previously aquired shared memory segment.
+ *
+ * @return -1 		- If the segment is too small to hold a descriptor ||
+ *			>= 0	- Offset of the descriptor
+ */
+int shmSchemaOffset(int shmid)
+{
+    struct shmid_ds shmInfo;
+    if (shmctl(shmid, IPC_STAT, &shmInfo) == -1)
+    {
+        perror("shmctl (obtaining size of shmid)");
+        return -1;
+    }
+
+    if (shmInfo.shm_segsz < sizeof(shmSchema_t) || shmInfo.shm_segsz - sizeof(shmSchema_t) > INT_MAX)
+        return -1;
+    return (shmInfo.shm_segsz - sizeof(shmSchema_t)) & ~(size_t)7;
+}
+
+/**
+ *
+ * @brief Return the schema descriptor location of a segment, at the end of the segment
+ *
+ * @return pointer to the descriptor ||
+ * 			NULL if the segment is too small to hold one
+ */
+static shmSchema_t *shmSchemaSlot(int shmid, void *segptr)
+{
+    int offset = shmSchemaOffset(shmid);
+    if (offset == -1)
+        return NULL;
+    return (shmSchema_t *)((uint8_t *)segptr + offset);
+}
+
+/**
+ *
+ * @brief Check that every field of a schema lies within schema->size and matches its type.
+ * Run it on any schema that did not come from shmSchemaFind before decoding with it.
+ *
+ * @param *schema:		Layout to check
+ *
+ * @return -1 		- If the schema is invalid ||
+ *			0		- If succes
+ */
+int shmSchemaValidate(const shmSchema_t *schema)
+{
+    if (schema->n_fields > SHM_SCHEMA_MAX_FIELDS)
+        return -1;
+
+    for (int i = 0; i < schema->n_fields; i++)
+    {
+        const shmField_t *field = &schema->fields[i];
+        int type_size = shmFieldTypeSize(field->type);
+        if (field->type != SHM_FIELD_BYTES && type_size != field->size)
+            return -1;
+        if (field->size == 0 || (int)field->offset + field->size > schema->size)
+            return -1;
+        if ((field->type == SHM_FIELD_F32 || field->type == SHM_FIELD_F64) && !(field->scale >= 0))
+            return -1;
+    }
+    return 0;
+}
+
+static uint32_t shmHashBytes(uint32_t hash, uint64_t v, int n)
+{
+    // FNV-1a, most significant byte first so every host hashes the same bytes
+    while (n-- > 0)
+    {
+        hash ^= (uint8_t)(v >> (n * 8));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ *
+ * @brief Hash of the layout of a schema (size and offset, size, type and scale of every field),
+ * equal on every host that registered the same layout. shmSchemaEncode sends it with every
+ * keyframe, so shmSchemaDecode can reject frames encoded with a different layout.
+ *
+ * @param *schema:		Layout to hash, the magic field is ignored
+ *
+ * @return hash of the layout
+ */
+uint32_t shmSchemaHash(const shmSchema_t *schema)
+{
+    uint32_t hash = 2166136261u;
+    int n_fields = schema->n_fields > SHM_SCHEMA_MAX_FIELDS ? SHM_SCHEMA_MAX_FIELDS : schema->n_fields;
+    uint32_t scale;
+
+    hash = shmHashBytes(hash, schema->size, 2);
+    hash = shmHashBytes(hash, schema->n_fields, 2);
+    for (int i = 0; i < n_fields; i++)
+    {
+        const shmField_t *field = &schema->fields[i];
+        memcpy(&scale, &field->scale, 4);
+        hash = shmHashBytes(hash, field->offset, 2);
+        hash = shmHashBytes(hash, field->size, 2);
+        hash = shmHashBytes(hash, field->type, 1);
+        hash = shmHashBytes(hash, scale, 4);
+    }
+    return hash;
+}
+
+/**
+ *
+ * @brief Register the layout of a shared memory segment, so the multicast bridge can encode
+ * its fields compactly and independent of the endianness of the hosts. The descriptor is stored
+ * at the end of the segment, create the segment with SHM_SCHEMA_SEG_SIZE(data size).
+ *
+ * @param shmid:     	The id of a previously aquired shared memory segment.
+ * @param *segptr:		Pointer to the shared memory segment
+ * @param *schema:		Layout of the segment data, the magic field is ignored
+ *
+ * @return -1 		- If the schema is invalid or does not fit the segment ||
+ *			0		- If succes
+ */
+int shmSchemaRegister(int shmid, void *segptr, const shmSchema_t *schema)
+{
+    if (shmSchemaValidate(schema) == -1)
+    {
+        printf("shmSchemaRegister: invalid schema (size: %d, fields: %d)\n", schema->size, schema->n_fields);
+        return -1;
+    }
+
+    shmSchema_t *slot = shmSchemaSlot(shmid, segptr);
+    if (slot == NULL || (uint8_t *)slot < (uint8_t *)segptr + schema->size)
+    {
+        printf("shmSchemaRegister: segment too small, use SHM_SCHEMA_SEG_SIZE(%d)\n", schema->size);
+        return -1;
+    }
+
+    // Unpublish, write the fields, then publish again, so shmSchemaFind never sees a half written schema
+    __atomic_store_n(&slot->magic, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t *)slot + sizeof(slot->magic), (const uint8_t *)schema + sizeof(slot->magic),
+           sizeof(shmSchema_t) - sizeof(slot->magic));
+    __atomic_store_n(&slot->magic, SHM_SCHEMA_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ *
+ * @brief Copy the schema registered for a shared memory segment. The segment is writable by
+ * every local process, so the copy is validated and the caller should keep using the copy.
+ *
+ * @param shmid:     	The id of a previously aquired shared memory segment.
+ * @param *segptr:		Pointer to the shared memory segment
+ * @param *schema:		Returns the validated schema
+ *
+ * @return -1 		- If no (valid) schema is registered ||
+ *			0		- If succes
+ */
+int shmSchemaFind(int shmid, void *segptr, shmSchema_t *schema)
+{
+    shmSchema_t *slot = shmSchemaSlot(shmid, segptr);
+    if (slot == NULL || __atomic_load_n(&slot->magic, __ATOMIC_ACQUIRE) != SHM_SCHEMA_MAGIC)
+        return -1;
+
+    memcpy(schema, slot, sizeof(shmSchema_t));
+
+    // Discard the copy when the schema was re-registered while copying
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->magic, __ATOMIC_RELAXED) != SHM_SCHEMA_MAGIC)
+        return -1;
+
+    // Still validate, any process can write the slot without shmSchemaRegister
+    if ((uint8_t *)segptr + schema->size > (uint8_t *)slot || shmSchemaValidate(schema) == -1)
+        return -1;
+    return 0;
+}
+
+static uint8_t *shmPutVarint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t *shmGetVarint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+static uint64_t shmZigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t shmUnzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int shmQuantize(double v, float scale, int64_t *q)
+{
+    v /= scale;
+
+    // Out of range for int64_t, also catches NaN and infinities
+    if (!(v > -9.2e18 && v < 9.2e18))
+        return -1;
+
+    *q = (int64_t)(v >= 0 ? v + 0.5 : v - 0.5);
+    return 0;
+}
+
+/**
+ *
+ * @brief Encode the fields of an object (in segment layout) into a compact, endianness
+ * independent buffer. Integers are sent as varints (signed ones zigzag encoded), floats
+ * with a scale as quantized varints, other floats big endian and byte fields as is.
+ *
+ * The buffer starts with a varint of the bitmap of the fields that follow, shifted left by one.
+ * When *prev is given only fields that differ from it are encoded, otherwise every field is
+ * (a keyframe): then the lowest bit is set and the big endian shmSchemaHash follows the varint.
+ *
+ * @param *schema:		Layout of the object
+ * @param *object:		Object to encode
+ * @param *prev:		Previously sent object to skip unchanged fields, NULL to encode all
+ * @param *buffer:		Output buffer
+ * @param size:         Size of the output buffer (in Bytes)
+ *
+ * @return -1 		- If the schema has too many fields, the buffer is too small or a quantized float
+ *					  is out of range (NaN, inf, too large) ||
+ *			>= 0	- Number of bytes written
+ */
+int shmSchemaEncode(const shmSchema_t *schema, const void *object, const void *prev, uint8_t *buffer, int size)
+{
+    const uint8_t *obj = (const uint8_t *)object;
+    const uint8_t *old = (const uint8_t *)prev;
+    uint8_t *p = buffer;
+    uint8_t *end = buffer + size;
+    uint32_t present = 0;
+
+    if (schema->n_fields > SHM_SCHEMA_MAX_FIELDS)
+        return -1;
+
+    for (int i = 0; i < schema->n_fields; i++)
+    {
+        const shmField_t *field = &schema->fields[i];
+        if (old == NULL || memcmp(obj + field->offset, old + field->offset, field->size) != 0)
+            present |= 1u << i;
+    }
+
+    uint8_t tmp[10];
+    int len = shmPutVarint(tmp, ((uint64_t)present << 1) | (old == NULL)) - tmp;
+    if (len > end - p)
+        return -1;
+    memcpy(p, tmp, len);
+    p += len;
+
+    if (old == NULL)
+    {
+        uint32_t hash = htobe32(shmSchemaHash(schema));
+        if (end - p < 4)
+            return -1;
+        memcpy(p, &hash, 4);
+        p += 4;
+    }
+
+    for (int i = 0; i < schema->n_fields; i++)
+    {
+        if (!(present & (1u << i)))
+            continue;
+
+        const shmField_t *field = &schema->fields[i];
+        const uint8_t *src = obj + field->offset;
+        const uint8_t *data = tmp;
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        int64_t q;
+        float f32;
+        double f64;
+
+        switch (field->type)
+        {
+        case SHM_FIELD_U8:
+            memcpy(&u8, src, 1);
+            len = shmPutVarint(tmp, u8) - tmp;
+            break;
+        case SHM_FIELD_S8:
+            memcpy(&u8, src, 1);
+            len = shmPutVarint(tmp, shmZigzag((int8_t)u8)) - tmp;
+            break;
+        case SHM_FIELD_U16:
+            memcpy(&u16, src, 2);
+            len = shmPutVarint(tmp, u16) - tmp;
+            break;
+        case SHM_FIELD_S16:
+            memcpy(&u16, src, 2);
+            len = shmPutVarint(tmp, shmZigzag((int16_t)u16)) - tmp;
+            break;
+        case SHM_FIELD_U32:
+            memcpy(&u32, src, 4);
+            len = shmPutVarint(tmp, u32) - tmp;
+            break;
+        case SHM_FIELD_S32:
+            memcpy(&u32, src, 4);
+            len = shmPutVarint(tmp, shmZigzag((int32_t)u32)) - tmp;
+            break;
+        case SHM_FIELD_U64:
+            memcpy(&u64, src, 8);
+            len = shmPutVarint(tmp, u64) - tmp;
+            break;
+        case SHM_FIELD_S64:
+            memcpy(&u64, src, 8);
+            len = shmPutVarint(tmp, shmZigzag((int64_t)u64)) - tmp;
+            break;
+        case SHM_FIELD_F32:
+            memcpy(&f32, src, 4);
+            if (field->scale > 0)
+            {
+                if (shmQuantize(f32, field->scale, &q) == -1)
+                    return -1;
+                len = shmPutVarint(tmp, shmZigzag(q)) - tmp;
+            }
+            else
+            {
+                memcpy(&u32, &f32, 4);
+                u32 = htobe32(u32);
+                memcpy(tmp, &u32, 4);
+                len = 4;
+            }
+            break;
+        case SHM_FIELD_F64:
+            memcpy(&f64, src, 8);
+            if (field->scale > 0)
+            {
+                if (shmQuantize(f64, field->scale, &q) == -1)
+                    return -1;
+                len = shmPutVarint(tmp, shmZigzag(q)) - tmp;
+            }
+            else
+            {
+                memcpy(&u64, &f64, 8);
+                u64 = htobe64(u64);
+                memcpy(tmp, &u64, 8);
+                len = 8;
+            }
+            break;
+        default:
+            data = src;
+            len = field->size;
+            break;
+        }
+
+        if (len > end - p)
+            return -1;
+        memcpy(p, data, len);
+        p += len;
+    }
+
+    return p - buffer;
+}
+
+/**
+ *
+ * @brief Decode a buffer made by shmSchemaEncode into an object (in segment layout).
+ * Fields that are not in the buffer keep their value in *object. The schema must be
+ * valid (from shmSchemaFind or checked with shmSchemaValidate). Keyframes carry the
+ * shmSchemaHash of the sender, they are rejected when it differs from *schema. Other
+ * frames carry no hash, only apply them after a verified keyframe.
+ *
+ * @param *schema:		Layout of the object
+ * @param *buffer:		Encoded buffer
+ * @param size:         Size of the encoded buffer (in Bytes)
+ * @param *object:		Object to decode into, at least schema->size bytes
+ *
+ * @return -1 		- If the buffer is malformed or encoded with a different schema ||
+ *			0		- If succes, the buffer had no schema hash ||
+ *			1		- If succes, the schema hash of the buffer matched
+ */
+int shmSchemaDecode(const shmSchema_t *schema, const uint8_t *buffer, int size, void *object)
+{
+    uint8_t *obj = (uint8_t *)object;
+    const uint8_t *p = buffer;
+    const uint8_t *end = buffer + size;
+    uint64_t present;
+    int has_hash;
+
+    if (schema->n_fields > SHM_SCHEMA_MAX_FIELDS)
+        return -1;
+    if ((p = shmGetVarint(p, end, &present)) == NULL)
+        return -1;
+    has_hash = present & 1;
+    present >>= 1;
+    if ((present >> schema->n_fields) != 0)
+        return -1;
+
+    if (has_hash)
+    {
+        uint32_t hash;
+        if (end - p < 4)
+            return -1;
+        memcpy(&hash, p, 4);
+        if (be32toh(hash) != shmSchemaHash(schema))
+            return -1;
+        p += 4;
+    }
+
+    for (int i = 0; i < schema->n_fields; i++)
+    {
+        if (!(present & (1ull << i)))
+            continue;
+
+        const shmField_t *field = &schema->fields[i];
+        uint8_t *dst = obj + field->offset;
+        uint64_t v = 0;
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        float f32;
+        double f64;
+
+        int is_raw_float = (field->type == SHM_FIELD_F32 || field->type == SHM_FIELD_F64) && !(field->scale > 0);
+        if (field->type == SHM_FIELD_BYTES || is_raw_float)
+        {
+            if (end - p < field->size)
+                return -1;
+        }
+        else if ((p = shmGetVarint(p, end, &v)) == NULL)
+        {
+            return -1;
+        }
+
+        switch (field->type)
+        {
+        case SHM_FIELD_U8:
+        case SHM_FIELD_S8:
+            u8 = field->type == SHM_FIELD_S8 ? (uint8_t)shmUnzigzag(v) : (uint8_t)v;
+            memcpy(dst, &u8, 1);
+            break;
+        case SHM_FIELD_U16:
+        case SHM_FIELD_S16:
+            u16 = field->type == SHM_FIELD_S16 ? (uint16_t)shmUnzigzag(v) : (uint16_t)v;
+            memcpy(dst, &u16, 2);
+            break;
+        case SHM_FIELD_U32:
+        case SHM_FIELD_S32:
+            u32 = field->type == SHM_FIELD_S32 ? (uint32_t)shmUnzigzag(v) : (uint32_t)v;
+            memcpy(dst, &u32, 4);
+            break;
+        case SHM_FIELD_U64:
+        case SHM_FIELD_S64:
+            v = field->type == SHM_FIELD_S64 ? (uint64_t)shmUnzigzag(v) : v;
+            memcpy(dst, &v, 8);
+            break;
+        case SHM_FIELD_F32:
+            if (is_raw_float)
+            {
+                memcpy(&u32, p, 4);
+                u32 = be32toh(u32);
+                memcpy(dst, &u32, 4);
+                p += 4;
+            }
+            else
+            {
+                f32 = shmUnzigzag(v) * field->scale;
+                memcpy(dst, &f32, 4);
+            }
+            break;
+        case SHM_FIELD_F64:
+            if (is_raw_float)
+            {
+                memcpy(&v, p, 8);
+                v = be64toh(v);
+                memcpy(dst, &v, 8);
+                p += 8;
+            }
+            else
+            {
+                f64 = shmUnzigzag(v) * (double)field->scale;
+                memcpy(dst, &f64, 8);
+            }
+            break;
+        default:
+            memcpy(dst, p, field->size);
+            p += field->size;
+            break;
+        }
+    }
+
+    if (p != end)
+        return -1;
+    return has_hash;
+}
+
 /**
  *
  * @brief Init shared memory for IPC (Inter Process Communication)
@@ -388,7 +1128,7 @@ int getSemVal(sem_t *sem)
  * @return -1 if an error occured ||
  * 			0 if success
  * */
-int8_t init_shared_mem(semShm_t *shm, int8_t key, uint16_t size)
+int8_t init_shared_mem(semShm_t *shm, int8_t key, uint32_t size)
 {
     shm->key = key;
     if ((shm->segptr = shmOpen(shm->key, size, &(shm->shmid), &(shm->sem), &(shm->createdSegment))) == (void *)-1)
@@ -406,6 +1146,7 @@ int8_t init_shared_mem(semShm_t *shm, int8_t key, uint16_t size)
     shm->w_lock_flag = 0;
     shm->r_blocking_flag = 0;
     shm->r_unlock_flag = 0;
+    shm->nt_threshold = shmNtThreshold;
 
     return 0;
 }
@@ -437,9 +1178,9 @@ int8_t shm_remove(semShm_t *shm)
  * @return -1 		- If an error occured ||
  *			0		- If succes
  */
-int8_t shm_write(semShm_t *shm, void *data, uint16_t size)
+int8_t shm_write(semShm_t *shm, void *data, uint32_t size)
 {
-    return shmWrite(data, size, shm->shmid, shm->segptr, shm->sem, shm->w_blocking_flag, shm->w_lock_flag);
+    return shmWriteEx(data, size, shm->shmid, shm->segptr, shm->sem, shm->w_blocking_flag, shm->w_lock_flag, shm->nt_threshold);
 }
 
 /**
@@ -454,7 +1195,23 @@ int8_t shm_write(semShm_t *shm, void *data, uint16_t size)
  * @return -1 		- If an error occured ||
  *			0		- If succes
  */
-int8_t shm_read(semShm_t *shm, void *data, uint16_t size)
+int8_t shm_read(semShm_t *shm, void *data, uint32_t size)
 {
     return shmRead(data, size, shm->shmid, shm->segptr, shm->sem, shm->r_blocking_flag, shm->r_unlock_flag);
 }
+
+/**
+ *
+ * @brief Register the layout of a shared memory segment, see shmSchemaRegister.
+ * Initialize the segment with init_shared_mem(shm, key, SHM_SCHEMA_SEG_SIZE(data size)).
+ *
+ * @param *shm: 		Pointer to shared memory struct (semShm_t)
+ * @param *schema:		Layout of the segment data
+ *
+ * @return -1 		- If an error occured ||
+ *			0		- If succes
+ */
+int8_t shm_register_schema(semShm_t *shm, const shmSchema_t *schema)
+{
+    return shmSchemaRegister(shm->shmid, shm->segptr, schema);
+}
@@ -0,0 +1,87 @@
+#include "shared_data/shared_data.h"
+#include <stdint.h>
+
+#define SEG_SIZE (16 * 1024 * 1024)
+#define WORKING_SET (256 * 1024)
+
+// Working set of a control loop that runs next to the copies
+uint8_t working_set[WORKING_SET];
+
+double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Walk the working set once, returns the time it took in ns
+double touch_working_set()
+{
+    volatile uint64_t sum = 0;
+    double start = now_ns();
+    for (int i = 0; i < WORKING_SET; i += 64)
+        sum += working_set[i];
+    return now_ns() - start;
+}
+
+void bench(const char *mode, size_t nt_threshold, int size, int shmid, void *segptr, sem_t *sem, uint8_t *object)
+{
+    int loops = (256 * 1024 * 1024) / size;
+    double write_ns = 0, write_ws_ns = 0, read_ns = 0, read_ws_ns = 0, start;
+
+    for (int i = 0; i < loops; i++)
+    {
+        touch_working_set();
+        start = now_ns();
+        shmWriteEx(object, size, shmid, segptr, sem, 1, 1, nt_threshold);
+        write_ns += now_ns() - start;
+        write_ws_ns += touch_working_set();
+    }
+
+    for (int i = 0; i < loops; i++)
+    {
+        touch_working_set();
+        start = now_ns();
+        shmReadEx(object, size, shmid, segptr, sem, 1, 1, nt_threshold);
+        read_ns += now_ns() - start;
+        read_ws_ns += touch_working_set();
+    }
+
+    printf("%-8s %9d | write %8.2f GB/s  ws %8.0f ns | read %8.2f GB/s  ws %8.0f ns\n",
+           mode, size,
+           (double)size * loops / write_ns, write_ws_ns / loops,
+           (double)size * loops / read_ns, read_ws_ns / loops);
+}
+
+int main()
+{
+    int shmid, newSegment;
+    sem_t *sem;
+    void *segptr = shmOpen(0x26, SEG_SIZE, &shmid, &sem, &newSegment);
+    if (segptr == (void *)-1)
+    {
+        printf("Failed open shared memory\n");
+        return 0;
+    }
+    if (newSegment)
+        sem_post(sem);
+
+    uint8_t *object = malloc(SEG_SIZE);
+    memset(object, 0x5a, SEG_SIZE);
+    memset(segptr, 0xa5, SEG_SIZE);
+    memset(working_set, 1, WORKING_SET);
+
+    printf("Streaming copy kernel: %s\n", shmCopyKernel());
+    printf("ws: time to walk a %d KiB working set after each copy\n\n", WORKING_SET / 1024);
+
+    int sizes[] = {64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024};
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        bench("memcpy", 0, sizes[i], shmid, segptr, sem, object);
+        bench("stream", 1, sizes[i], shmid, segptr, sem, object);
+    }
+
+    free(object);
+    shmRemove(shmid, segptr);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "shared_data/shared_data.h"
+#include <stdint.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    // usage: mcast_send [key] [rate pkt/s, 0 = unlimited] [seconds] [payload bytes] [addr] [port]
+    int key = argc > 1 ? atoi(argv[1]) : 123;
+    uint64_t rate = argc > 2 ? strtoull(argv[2], NULL, 10) : 100000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    int size = argc > 4 ? atoi(argv[4]) : 64;
+    char *addr = argc > 5 ? argv[5] : "224.16.32.12";
+    int port = argc > 6 ? atoi(argv[6]) : 4218;
+
+    if (size < 1 || size > MCAST_MAX_PAYLOAD)
+    {
+        printf("Payload must be 1..%d bytes\n", MCAST_MAX_PAYLOAD);
+        return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    // Send over loopback and deliver to receivers on this host
+    struct in_addr iface;
+    iface.s_addr = inet_addr("127.0.0.1");
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    uint8_t loop = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    dst.sin_addr.s_addr = inet_addr(addr);
+
+    uint8_t *packet = calloc(1, sizeof(mcastHdr_t) + size);
+    mcastHdr_t *hdr = (mcastHdr_t *)packet;
+    hdr->magic = htonl(MCAST_MAGIC);
+    hdr->key = htonl(key);
+    hdr->len = htons(size);
+
+    printf("Sending key %d, %d bytes at %lu pkt/s for %d s to %s:%d\n", key, size, rate, seconds, addr, port);
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * 1000000000ull;
+    uint64_t period = rate ? 1000000000ull / rate : 0;
+    uint64_t next = start;
+    uint32_t seq = 0;
+    uint64_t failed = 0;
+    while (now_ns() < end)
+    {
+        // Busy wait to keep the rate steady, sleeping is too coarse at these rates
+        while (period && now_ns() < next)
+            ;
+        next += period;
+
+        hdr->seq = htonl(seq++);
+        hdr->stamp_ns = htobe64(now_ns());
+        memcpy(packet + sizeof(mcastHdr_t), &seq, size < 4 ? size : 4);
+        if (sendto(fd, packet, sizeof(mcastHdr_t) + size, 0, (struct sockaddr *)&dst, sizeof(dst)) == -1)
+            failed++;
+    }
+
+    printf("Sent %u packets (%.0f pkt/s), %lu failed\n", seq, seq / ((now_ns() - start) / 1e9), failed);
+    free(packet);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef EX_DATA_H
+#define EX_DATA_H
+
+#include "shared_data/shared_data.h"
+
+// Same packed, unaligned layout as ex_test1, with a float added
+typedef struct __attribute__((packed))
+{
+    char str[8];
+    uint8_t data1;
+    int16_t data2;
+    uint16_t data3;
+    float heading; // Degrees, sent with 0.01 degree resolution
+} ex_data_t;
+
+// Works from C (_Generic) and C++ (templates)
+static const shmSchema_t ex_schema = {
+    SHM_SCHEMA_MAGIC,
+    sizeof(ex_data_t),
+    5,
+    {
+        SHM_FIELD_MEMBER(ex_data_t, str),
+        SHM_FIELD_MEMBER(ex_data_t, data1),
+        SHM_FIELD_MEMBER(ex_data_t, data2),
+        SHM_FIELD_MEMBER(ex_data_t, data3),
+        SHM_FIELD_MEMBER_QUANT(ex_data_t, heading, 0.01f),
+    }};
+
+#endif // EX_DATA_H
@@ -0,0 +1,48 @@
+#include "ex_data.h"
+#include <stdint.h>
+#include <signal.h>
+
+semShm_t shm_ex;
+
+void sigint_handler(int sig)
+{
+    shm_remove(&shm_ex);
+    exit(0);
+}
+
+int main()
+{
+    signal(SIGINT, sigint_handler);
+
+    // Must match config/data.txt, the segment is created with room for the schema
+    int8_t key = 123;
+    uint16_t shm_size = 64;
+    if (init_shared_mem(&shm_ex, key, SHM_SCHEMA_SEG_SIZE(shm_size)) == -1)
+    {
+        printf("Failed open shared memory\n");
+        return 0;
+    }
+
+    // Tell the multicast daemon how to decode this segment
+    if (shm_register_schema(&shm_ex, &ex_schema) == -1)
+    {
+        printf("Failed register schema\n");
+        return 0;
+    }
+
+    printf("Success open shared memory with schema\n");
+
+    while (1)
+    {
+        sleep(1);
+        ex_data_t data;
+        shm_read(&shm_ex, &data, sizeof(data));
+
+        char str[9] = {0};
+        memcpy(str, data.str, 8);
+        printf("str: %s | data1: %d | data2: %d | data3: %d | heading: %.2f\n",
+               str, data.data1, data.data2, data.data3, data.heading);
+    }
+
+    return 0;
+}
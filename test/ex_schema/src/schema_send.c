@@ -0,0 +1,99 @@
+#include "ex_data.h"
+#include <stdint.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define KEYFRAME_INTERVAL 100
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    // usage: schema_send [key] [frames/s] [seconds] [addr] [port]
+    int key = argc > 1 ? atoi(argv[1]) : 123;
+    int rate = argc > 2 ? atoi(argv[2]) : 100;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    char *addr = argc > 4 ? argv[4] : "224.16.32.12";
+    int port = argc > 5 ? atoi(argv[5]) : 4218;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    // Send over loopback and deliver to receivers on this host
+    struct in_addr iface;
+    iface.s_addr = inet_addr("127.0.0.1");
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    uint8_t loop = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    dst.sin_addr.s_addr = inet_addr(addr);
+
+    uint8_t packet[sizeof(mcastHdr_t) + MCAST_MAX_PAYLOAD];
+    mcastHdr_t *hdr = (mcastHdr_t *)packet;
+    hdr->magic = htonl(MCAST_MAGIC);
+    hdr->key = htonl(key);
+
+    ex_data_t data, prev;
+    memset(&data, 0, sizeof(data));
+    memcpy(data.str, "itssmasa", 8);
+    data.data1 = 12;
+    data.data2 = -2353;
+    data.data3 = 3456;
+    data.heading = 0;
+
+    uint64_t frames = 0, bytes = 0;
+    uint64_t end = now_ns() + (uint64_t)seconds * 1000000000ull;
+    while (now_ns() < end)
+    {
+        // Keyframes let receivers recover from lost datagrams
+        int keyframe = frames % KEYFRAME_INTERVAL == 0;
+        int len = shmSchemaEncode(&ex_schema, &data, keyframe ? NULL : &prev, packet + sizeof(mcastHdr_t), MCAST_MAX_PAYLOAD);
+        if (len == -1)
+        {
+            printf("Failed to encode frame\n");
+            break;
+        }
+
+        hdr->seq = htonl(frames);
+        hdr->len = htons(len);
+        hdr->flags = htons(MCAST_FLAG_SCHEMA | (keyframe ? MCAST_FLAG_KEYFRAME : 0));
+        hdr->stamp_ns = htobe64(now_ns());
+        if (sendto(fd, packet, sizeof(mcastHdr_t) + len, 0, (struct sockaddr *)&dst, sizeof(dst)) == -1)
+            perror("sendto");
+
+        frames++;
+        bytes += len;
+        prev = data;
+
+        // Change the data like ex_test1 does, the string only now and then
+        data.data1++;
+        data.data2--;
+        data.data3 += 2;
+        data.heading += 0.25f;
+        if (data.heading >= 360)
+            data.heading -= 360;
+        if (frames % 500 == 0)
+            memcpy(data.str, frames % 1000 ? "smasaits" : "itssmasa", 8);
+
+        usleep(1000000 / rate);
+    }
+
+    printf("Sent %lu frames, %.2f bytes/frame encoded vs %lu bytes raw\n",
+           frames, frames ? (double)bytes / frames : 0, sizeof(ex_data_t));
+    return 0;
+}